@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #define FMC_IMPLEMENTATION
@@ -23,6 +24,7 @@ int main() {
     fmc::AttributeInfo::set_data<vec3>(fmc::ATTR_NORM);
     fmc::AttributeInfo::set_data<vec3>(fmc::ATTR_COL);
     fmc::AttributeInfo::set_data<vec2>(fmc::ATTR_UV);
+    fmc::AttributeInfo::set_data<vec3>(fmc::ATTR_TAN);
 
     // Owned vertex testing
     {
@@ -117,5 +119,112 @@ int main() {
         assert(("Mesh move construction failed", mesh0.size() == 0));
     }
 
+    // Compression testing
+    {
+        fmc::Mesh mesh0({fmc::ATTR_POS, fmc::ATTR_COL, fmc::ATTR_UV});
+        for (size_t i = 0; i < 40000; ++i) {
+            mesh0.push_back(vec3(i * 0.25f, -(float)i, 1.f), vec3(1.f, 0.5f, 0.f), vec2(i / 40000.f, 0.f));
+        }
+
+        std::vector<char> compressed = mesh0.compress();
+        assert(("Mesh compression failed", compressed.size() < mesh0.size() * mesh0.get_vertex_size()));
+
+        fmc::Mesh mesh1({fmc::ATTR_POS, fmc::ATTR_COL, fmc::ATTR_UV});
+        mesh1.push_back(vec3(0.f, 0.f, 0.f), vec3(0.f, 0.f, 0.f), vec2(0.f, 0.f));
+        bool decompressed = mesh1.decompress(compressed.data(), compressed.size());
+        assert(("Mesh decompression failed", decompressed && mesh1.size() == mesh0.size()));
+        assert(("Mesh decompression failed", memcmp(mesh0.data(), mesh1.data(), mesh0.size() * mesh0.get_vertex_size()) == 0));
+        assert(("Mesh decompression failed", mesh1[39999][fmc::ATTR_POS].get<vec3>().y == -39999.f));
+
+        decompressed = mesh1.decompress(compressed.data(), compressed.size() / 2);
+        assert(("Mesh decompression of truncated data succeeded", !decompressed && mesh1.size() == 0));
+        // Claim one more vertex than was compressed, which makes the last block decode to the wrong size
+        compressed[8 + 3 * 8]++;
+        decompressed = mesh1.decompress(compressed.data(), compressed.size());
+        assert(("Mesh decompression of corrupt data succeeded", !decompressed && mesh1.size() == 0));
+
+        compressed[8 + 3 * 8]--;
+        fmc::AttributeInfo::set_data<vec2>(fmc::ATTR_COL);
+        fmc::Mesh mesh2({fmc::ATTR_POS, fmc::ATTR_COL, fmc::ATTR_UV});
+        decompressed = mesh2.decompress(compressed.data(), compressed.size());
+        assert(("Mesh decompression into different attribute sizes succeeded", !decompressed));
+        fmc::AttributeInfo::set_data<vec3>(fmc::ATTR_COL);
+    }
+
+    // Derived attribute testing
+    {
+        fmc::Mesh mesh0({fmc::ATTR_POS, fmc::ATTR_UV});
+        mesh0.push_back(vec3(0.f, 0.f, 0.f), vec2(0.f, 0.f));
+        mesh0.push_back(vec3(1.f, 0.f, 0.f), vec2(1.f, 0.f));
+        mesh0.push_back(vec3(1.f, 1.f, 0.f), vec2(1.f, 1.f));
+        mesh0.push_back(vec3(0.f, 1.f, 0.f), vec2(0.f, 1.f));
+        mesh0.set_indices({0, 1, 2, 0, 2, 3});
+        mesh0.derive(fmc::ATTR_NORM, fmc::DERIVE_SMOOTH_NORMALS);
+        mesh0.derive(fmc::ATTR_TAN, fmc::DERIVE_TANGENTS);
+        assert(("Mesh normal derivation failed", mesh0.view<vec3>(fmc::ATTR_NORM)[3].z == 1.f));
+        assert(("Mesh tangent derivation failed", mesh0.view<vec3>(fmc::ATTR_TAN)[3].x == 1.f));
+
+        // Flip the quad to face the other way, the normals should follow after invalidating the positions
+        for (size_t i = 0; i < mesh0.size(); ++i) {
+            mesh0[i][fmc::ATTR_POS].get<vec3>().x *= -1.f;
+        }
+        mesh0.invalidate(fmc::ATTR_POS);
+        assert(("Mesh derived attribute invalidation failed", mesh0.view<vec3>(fmc::ATTR_NORM)[0].z == -1.f));
+        assert(("Mesh derived attribute invalidation failed", mesh0.view<vec3>(fmc::ATTR_TAN)[0].x == -1.f));
+
+        fmc::Mesh mesh1(mesh0);
+        mesh1.push_back(vec3(0.f, 0.f, 0.f), vec2(0.f, 0.f));
+        mesh1.push_back(vec3(0.f, 0.f, 1.f), vec2(0.f, 0.f));
+        mesh1.push_back(vec3(0.f, 1.f, 0.f), vec2(0.f, 0.f));
+        mesh1.set_indices({});
+        mesh1.derive(fmc::ATTR_NORM, fmc::DERIVE_FLAT_NORMALS);
+        mesh1.update_derived();
+        const fmc::Mesh& constMesh1 = mesh1;
+        assert(("Mesh flat normal derivation failed", constMesh1.view<vec3>(fmc::ATTR_NORM)[5].x == -1.f));
+
+        // Repacking turns derived attributes into regular attributes of the new mesh
+        fmc::Mesh mesh2 = fmc::repack(mesh0, {fmc::ATTR_POS, fmc::ATTR_NORM});
+        assert(("Mesh derived attribute repacking failed", mesh2[0][fmc::ATTR_NORM].get<vec3>().z == -1.f));
+
+        // Viewing the normals only recomputes the normals, and the tangents that are still out of date can stay behind when repacking
+        mesh0.invalidate(fmc::ATTR_POS);
+        mesh0.view<vec3>(fmc::ATTR_NORM);
+        fmc::Mesh mesh3 = fmc::repack(mesh0, {fmc::ATTR_POS, fmc::ATTR_NORM, fmc::ATTR_UV});
+        assert(("Mesh partial derived attribute update failed", mesh3.view<vec3>(fmc::ATTR_TAN)[0].x == -1.f));
+
+        // Clearing removes the indices along with the vertices they refer to
+        mesh0.clear();
+        assert(("Mesh index clearing failed", mesh0.get_indices().empty()));
+        mesh0.push_back(vec3(0.f, 0.f, 0.f), vec2(0.f, 0.f));
+        mesh0.push_back(vec3(0.f, 1.f, 0.f), vec2(0.f, 1.f));
+        mesh0.push_back(vec3(1.f, 0.f, 0.f), vec2(1.f, 0.f));
+        assert(("Mesh derivation after clearing failed", mesh0.view<vec3>(fmc::ATTR_NORM)[0].z == -1.f));
+    }
+
+    // Attribute view and repacking testing
+    {
+        fmc::Mesh mesh0({fmc::ATTR_POS, fmc::ATTR_NORM, fmc::ATTR_COL, fmc::ATTR_UV});
+        for (size_t i = 0; i < 10000; ++i) {
+            mesh0.push_back(vec3((float)i, 0.f, 0.f), vec3(0.f, 0.f, 1.f), vec3(1.f, 1.f, 1.f), vec2(0.f, (float)i));
+        }
+
+        fmc::AttributeView<vec2> uvs = mesh0.view<vec2>(fmc::ATTR_UV);
+        assert(("Mesh attribute view failed", uvs.size() == 10000 && uvs[9].y == 9.f));
+        std::for_each(uvs.begin(), uvs.end(), [](vec2& _uv) { _uv.x = _uv.y * 2.f; });
+        assert(("Mesh attribute view writing failed", mesh0[100][fmc::ATTR_UV].get<vec2>().x == 200.f));
+        auto found = std::find_if(uvs.begin(), uvs.end(), [](const vec2& _uv) { return _uv.y == 42.f; });
+        assert(("Mesh attribute view iteration failed", found - uvs.begin() == 42));
+
+        fmc::Mesh mesh1 = fmc::repack(mesh0, {fmc::ATTR_UV, fmc::ATTR_POS});
+        assert(("Mesh repacking failed", mesh1.size() == 10000));
+        assert(("Mesh repacking failed", mesh1.get_vertex_size() == sizeof(vec2) + sizeof(vec3)));
+        assert(("Mesh repacking failed", mesh1[9999][fmc::ATTR_POS].get<vec3>().x == 9999.f));
+        assert(("Mesh repacking failed", mesh1[9999][fmc::ATTR_UV].get<vec2>().x == 19998.f));
+
+        const fmc::Mesh mesh2 = fmc::repack(mesh0, {fmc::ATTR_POS});
+        fmc::AttributeView<const vec3> positions = mesh2.view<vec3>(fmc::ATTR_POS);
+        assert(("Mesh attribute view contiguity failed", positions.is_contiguous() && positions.data()[5].x == 5.f));
+    }
+
     return 0;
 }
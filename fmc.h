@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <type_traits>
 #include <typeinfo>
 #include <vector>
 
@@ -11,10 +19,21 @@ namespace fmc {
         ATTR_NORM,
         ATTR_COL,
         ATTR_UV,
+        ATTR_TAN,
 
         ATTRIBUTE_COUNT
     };
 
+    // The ways an attribute can be derived from the other attributes of a mesh
+    enum Derivation {
+        // Normals (3 floats) from the positions (3 floats), every vertex uses the normal of a triangle it is part of
+        DERIVE_FLAT_NORMALS,
+        // Normals (3 floats) from the positions (3 floats), averaging the area weighted normals of all triangles a vertex is part of
+        DERIVE_SMOOTH_NORMALS,
+        // Tangents (3 floats, or 4 floats to include the bitangent sign) from the positions, normals (3 floats), and UVs (2 floats)
+        DERIVE_TANGENTS
+    };
+
     // Global class that holds data type hash ID's and sizes, indexed by the vertex attribute enum
     class AttributeInfo {
     public:
@@ -40,9 +59,82 @@ namespace fmc {
         }
     };
 
+    // View class, giving typed access to a single attribute of every vertex in a mesh without copying the data.
+    // The iterators are random access, so the view can be used with the standard algorithms
+    template <class T> class AttributeView {
+        // The byte type of the mesh's buffer, which is const for views of const data
+        using Byte = std::conditional_t<std::is_const<T>::value, const char, char>;
+
+    public:
+        class Iterator {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = std::remove_const_t<T>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            Iterator() : m_data(nullptr), m_stride(0) {}
+            Iterator(Byte* _data, size_t _stride) : m_data(_data), m_stride(_stride) {}
+
+            T& operator*() const { return *(T*)m_data; }
+            T* operator->() const { return (T*)m_data; }
+            T& operator[](difference_type _offset) const { return *(T*)(m_data + _offset * (difference_type)m_stride); }
+            Iterator& operator++() { m_data += m_stride; return *this; }
+            Iterator operator++(int) { Iterator old = *this; m_data += m_stride; return old; }
+            Iterator& operator--() { m_data -= m_stride; return *this; }
+            Iterator operator--(int) { Iterator old = *this; m_data -= m_stride; return old; }
+            Iterator& operator+=(difference_type _offset) { m_data += _offset * (difference_type)m_stride; return *this; }
+            Iterator& operator-=(difference_type _offset) { m_data -= _offset * (difference_type)m_stride; return *this; }
+            Iterator operator+(difference_type _offset) const { return Iterator(m_data + _offset * (difference_type)m_stride, m_stride); }
+            Iterator operator-(difference_type _offset) const { return Iterator(m_data - _offset * (difference_type)m_stride, m_stride); }
+            friend Iterator operator+(difference_type _offset, const Iterator& _iterator) { return _iterator + _offset; }
+            difference_type operator-(const Iterator& _other) const { return (m_data - _other.m_data) / (difference_type)m_stride; }
+            bool operator==(const Iterator& _other) const { return m_data == _other.m_data; }
+            bool operator!=(const Iterator& _other) const { return m_data != _other.m_data; }
+            bool operator<(const Iterator& _other) const { return m_data < _other.m_data; }
+            bool operator>(const Iterator& _other) const { return m_data > _other.m_data; }
+            bool operator<=(const Iterator& _other) const { return m_data <= _other.m_data; }
+            bool operator>=(const Iterator& _other) const { return m_data >= _other.m_data; }
+
+        private:
+            Byte* m_data;
+            size_t m_stride;
+        };
+
+        AttributeView(Byte* _data, size_t _stride, size_t _count) : m_data(_data), m_stride(_stride), m_count(_count) {}
+
+        T& operator[](size_t _index) const {
+            assert(("Index out of range", _index < m_count));
+
+            return *(T*)(m_data + _index * m_stride);
+        }
+        Iterator begin() const { return Iterator(m_data, m_stride); }
+        Iterator end() const { return Iterator(m_data + m_count * m_stride, m_stride); }
+        size_t size() const { return m_count; }
+        // Retrieve the distance in bytes between two consecutive elements
+        size_t stride() const { return m_stride; }
+        // The elements are only contiguous when the mesh has a single attribute, in which case data() and size() can be used as a span
+        bool is_contiguous() const { return m_stride == sizeof(T); }
+        T* data() const { return (T*)m_data; }
+
+    private:
+        Byte* m_data;
+        size_t m_stride;
+        size_t m_count;
+    };
+
+    class Mesh;
+    // Create a new mesh holding the given attributes of every vertex in the source mesh, copying the vertex data in a single pass.
+    // The attributes must be a subset of the source mesh's attributes and derived attributes, but may be in a different order.
+    // Derived attributes that are repacked have to be up to date, the others keep their derivation when their sources are kept
+    Mesh repack(const Mesh& _source, const std::vector<Attribute>& _attributes, size_t _threadCount = 0);
+
     class Vertex;
     // Mesh class, storing the data of a mesh, which attributes define the mesh, and the size of a single vertex in bytes
     class Mesh {
+        friend Mesh repack(const Mesh& _source, const std::vector<Attribute>& _attributes, size_t _threadCount);
+
     public:
         Mesh(std::initializer_list<Attribute> _attributes);
         Mesh(const std::vector<Attribute>& _attributes);
@@ -54,6 +146,12 @@ namespace fmc {
         // When accessing the model using the [] operator (which specifies what vertex you want to access),
         // return an object holding the address of said vertex
         Vertex& operator[](size_t _index);
+        // Retrieve a typed view over a single attribute of every vertex, which points straight into the mesh's buffer, or into the
+        // stream of a derived attribute. The non-const version of a derived attribute's view brings it up to date first, the const
+        // version asserts that it is. The view is invalidated when the buffer is reallocated, and writes to the source of a
+        // derived attribute require invalidate()
+        template <class T> AttributeView<T> view(Attribute _attribute);
+        template <class T> AttributeView<const T> view(Attribute _attribute) const;
         // Add a vertex to the mesh
         template <class T, class... Ts> void push_back(T const& _first, Ts const&... _rest);
         void push_back(const Vertex& _vertex);
@@ -70,6 +168,25 @@ namespace fmc {
         // Extends the data container to fit the requested amount of vertices
         void reserve(size_t _vertexCount);
         void clear();
+        // Compress the vertex data into a lossless byte stream, which is useful for storing or transferring the mesh.
+        // A thread count of 0 makes use of all hardware threads. Derived attributes aren't stored, as they can be recomputed
+        std::vector<char> compress(size_t _threadCount = 0) const;
+        // Decompress a byte stream created by compress() straight into the mesh's buffer, replacing its current vertices.
+        // Returns false and leaves the mesh empty when the data is corrupt, truncated, or uses different attributes or attribute sizes
+        bool decompress(const char* _data, size_t _size, size_t _threadCount = 0);
+        // Declare an attribute as derived from the attributes of the mesh. The results are stored in a separate stream per derived
+        // attribute rather than in the vertices, so the attribute can't be one of the mesh's attributes and is read through view().
+        // Derived attributes are computed by update_derived(), or on the next call to the non-const view() after their sources changed
+        void derive(Attribute _attribute, Derivation _derivation);
+        // Notify the mesh that an attribute was changed through a vertex reference, so the attributes derived from it get recomputed.
+        // Pushing back, copying, and decompressing already take care of this
+        void invalidate(Attribute _attribute);
+        // Recompute the derived attributes whose source attributes have changed
+        void update_derived();
+        // Set the triangle indices that are used to derive attributes, without indices every 3 consecutive vertices form a triangle.
+        // The indices are cleared along with the vertices, and flat normals can only be derived from meshes without indices
+        void set_indices(const std::vector<uint32_t>& _indices);
+        const std::vector<uint32_t>& get_indices() const;
 
         Mesh() = delete;
 
@@ -80,17 +197,84 @@ namespace fmc {
         size_t m_vertexSize;
         size_t m_vertexCount;
         size_t m_capacity;
+        std::vector<uint32_t> m_indices;
+
+        // An attribute that is derived from the other attributes, which has to be recomputed when it's dirty.
+        // Its value for every vertex is stored contiguously in its stream
+        struct DerivedAttribute {
+            Attribute m_attribute;
+            Derivation m_derivation;
+            bool m_dirty;
+            std::vector<char> m_stream;
+        };
+        // Sorted by derivation, so normals are always computed before the tangents that depend on them
+        std::vector<DerivedAttribute> m_derived;
+
+        // The amount of vertices that are compressed together, blocks are independent so they can be decompressed in parallel
+        static constexpr size_t COMPRESSION_BLOCK_SIZE = 16384;
+        // The largest block size that is accepted when decompressing, which bounds how far a block can expand
+        static constexpr size_t COMPRESSION_BLOCK_SIZE_MAX = 65536;
+        // rANS probabilities are stored as fractions of 2^RANS_SCALE_BITS, and the coder states stay within [RANS_LOWER_BOUND, 2^32),
+        // which means a state is renormalized by shifting in a single 16 bit word
+        static constexpr uint32_t RANS_SCALE_BITS = 12;
+        static constexpr uint32_t RANS_LOWER_BOUND = 1u << 16;
+        static constexpr size_t RANS_STATE_COUNT = 8;
+        // Vertices rebuilt together when decompressing, small enough for the batch to stay in the L1 cache
+        static constexpr size_t DECOMPRESSION_BATCH_SIZE = 256;
+        // The ways a single byte plane of a compressed block can be stored, either directly or as runs of its most common byte
+        enum PlaneEncoding {
+            PLANE_DIRECT,
+            PLANE_RUN_LENGTH
+        };
+        // The ways a sequence of bytes can be stored after the plane encoding
+        enum ByteEncoding {
+            BYTES_CONSTANT,
+            BYTES_RAW,
+            BYTES_RANS
+        };
 
         // Add a vertex element to the mesh
         template <class T, class... Ts> void push_back_rest(char* _address, size_t _attribute, T const& _first, Ts const&... _rest);
         // Reallocates the vertex buffer
         void reallocate(size_t _capacity);
+        // Call the function for every index in the range, spreading the calls over multiple threads
+        template <class F> static void parallel_for(size_t _count, size_t _threadCount, F _function);
+        // Copy _size bytes from every source element to every destination element, with the common sizes known at compile time
+        template <size_t S> static void copy_strided(char* _destination, size_t _destinationStride, const char* _source, size_t _sourceStride, size_t _count);
+        static void copy_strided(char* _destination, size_t _destinationStride, const char* _source, size_t _sourceStride, size_t _size, size_t _count);
+        // Compress or decompress a single block of vertices
+        void compress_block(size_t _first, size_t _count, std::vector<char>& _output) const;
+        bool decompress_block(const char* _data, size_t _size, size_t _first, size_t _count);
+        // Compress a single byte plane, run length encoding its most common byte when that removes most of the bytes
+        static void compress_plane(const unsigned char* _plane, size_t _count, std::vector<char>& _output);
+        static bool decompress_plane(const unsigned char*& _input, const unsigned char* _inputEnd, unsigned char* _plane, size_t _count);
+        // Entropy code a sequence of bytes with an order-0 rANS coder that interleaves 8 states,
+        // falling back to storing the bytes as is when that is smaller
+        static void compress_bytes(const unsigned char* _bytes, size_t _count, std::vector<char>& _output);
+        static bool decompress_bytes(const unsigned char*& _input, const unsigned char* _inputEnd, unsigned char* _bytes, size_t _count);
+        // Retrieve the offset in bytes of an attribute within a vertex
+        size_t get_offset(Attribute _attribute) const;
+        // Retrieve a derived attribute, or nullptr when the attribute isn't derived
+        DerivedAttribute* find_derived(Attribute _attribute);
+        const DerivedAttribute* find_derived(Attribute _attribute) const;
+        // Retrieve the address of an attribute's value for the first vertex and the stride between vertices,
+        // which points into the mesh's buffer or into the stream of a derived attribute
+        const char* get_source(Attribute _attribute, size_t& _stride) const;
+        // Mark every derived attribute as dirty, for when all vertex data has been replaced
+        void invalidate_derived();
+        // Recompute a single derived attribute when it's dirty, after the derived attributes it depends on
+        void update_derived(DerivedAttribute& _derived);
+        // Store for every vertex the triangles it is part of, _adjacencyStart holds where each vertex's triangles start in _adjacency
+        void build_adjacency(std::vector<uint32_t>& _adjacencyStart, std::vector<uint32_t>& _adjacency) const;
+        void compute_normals(DerivedAttribute& _derived);
+        void compute_tangents(DerivedAttribute& _derived);
     };
 
     // Vertex class, holding either an address that points towards the starting position of its data in the mesh's buffer,
     // or an address that points towards its owned data
     class Vertex {
         friend Mesh;
+        friend Mesh repack(const Mesh& _source, const std::vector<Attribute>& _attributes, size_t _threadCount);
 
         // Vertex element class, holding an address that points towards the starting position of its data in the vertex's buffer
         class Element {
@@ -170,6 +354,7 @@ namespace fmc {
 
         m_vertices[m_vertexCount].initialize(m_data + m_vertexCount * m_vertexSize, &m_attributes);
         m_vertexCount++;
+        invalidate_derived();
     }
     template <class T, class... Ts>
     void Mesh::push_back_rest(char* _address, size_t _attribute, T const& _first, Ts const&... _rest) {
@@ -184,6 +369,61 @@ namespace fmc {
         }
     }
 
+    template <class T>
+    AttributeView<T> Mesh::view(Attribute _attribute) {
+        assert(("Incorrect type in attribute view", typeid(T).hash_code() == AttributeInfo::get_type(_attribute)));
+
+        DerivedAttribute* derived = find_derived(_attribute);
+        if (derived) {
+            update_derived(*derived);
+            return AttributeView<T>(derived->m_stream.data(), sizeof(T), m_vertexCount);
+        }
+        return AttributeView<T>(m_data + get_offset(_attribute), m_vertexSize, m_vertexCount);
+    }
+    template <class T>
+    AttributeView<const T> Mesh::view(Attribute _attribute) const {
+        assert(("Incorrect type in attribute view", typeid(T).hash_code() == AttributeInfo::get_type(_attribute)));
+        const DerivedAttribute* derived = find_derived(_attribute);
+        if (derived) {
+            // A const mesh can't recompute its derived attributes, as it may be read from multiple threads at once
+            assert(("Derived attribute is out of date, call update_derived() first", !derived->m_dirty));
+            return AttributeView<const T>(derived->m_stream.data(), sizeof(T), m_vertexCount);
+        }
+        return AttributeView<const T>(m_data + get_offset(_attribute), m_vertexSize, m_vertexCount);
+    }
+
+    template <size_t S>
+    void Mesh::copy_strided(char* _destination, size_t _destinationStride, const char* _source, size_t _sourceStride, size_t _count) {
+        for (size_t index = 0; index < _count; ++index) {
+            memcpy((void*)(_destination + index * _destinationStride), (const void*)(_source + index * _sourceStride), S);
+        }
+    }
+
+    template <class F>
+    void Mesh::parallel_for(size_t _count, size_t _threadCount, F _function) {
+        if (_threadCount == 0) {
+            _threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+        _threadCount = std::min(_threadCount, _count);
+
+        // Every thread keeps taking the next unprocessed index until the range is exhausted
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t index = next++; index < _count; index = next++) {
+                _function(index);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t thread = 1; thread < _threadCount; ++thread) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
     template <class T, class... Ts>
     Vertex::Vertex(std::initializer_list<Attribute> _attributes, T const& _first, Ts const&... _rest) {
         assert(("The argument count does not match the attribute count", sizeof...(_rest) == _attributes.size() - 1));
@@ -300,7 +540,8 @@ namespace fmc {
         free(m_data);
         free(m_vertices);
     }
-    Mesh::Mesh(const Mesh& _other) : m_attributes(_other.m_attributes), m_vertexSize(_other.m_vertexSize), m_vertexCount(_other.m_vertexCount), m_capacity(m_vertexCount) {
+    Mesh::Mesh(const Mesh& _other) : m_attributes(_other.m_attributes), m_vertexSize(_other.m_vertexSize), m_vertexCount(_other.m_vertexCount), m_capacity(m_vertexCount),
+        m_indices(_other.m_indices), m_derived(_other.m_derived) {
         m_data = (char*)malloc(m_vertexCount * m_vertexSize);
         memcpy((void*)m_data, (void*)_other.m_data, m_vertexCount * m_vertexSize);
 
@@ -333,6 +574,8 @@ namespace fmc {
 
             m_attributes = _other.m_attributes;
             m_vertexSize = _other.m_vertexSize;
+            m_indices = _other.m_indices;
+            m_derived = _other.m_derived;
 
             memcpy((void*)m_data, (void*)_other.m_data, m_vertexCount * m_vertexSize);
         }
@@ -345,6 +588,8 @@ namespace fmc {
         m_vertexSize = std::move(_other.m_vertexSize);
         m_vertexCount = std::move(_other.m_vertexCount);
         m_capacity = std::move(_other.m_capacity);
+        m_indices = std::move(_other.m_indices);
+        m_derived = std::move(_other.m_derived);
 
         for (size_t index = 0; index < m_vertexCount; ++index) {
             m_vertices[index].m_attributes = &m_attributes;
@@ -356,6 +601,8 @@ namespace fmc {
         _other.m_vertexSize = 0;
         _other.m_vertexCount = 0;
         _other.m_capacity = 0;
+        _other.m_indices.clear();
+        _other.m_derived.clear();
     }
     Mesh& Mesh::operator=(Mesh&& _other) {
         if (this != &_other) {
@@ -378,6 +625,8 @@ namespace fmc {
             m_vertexSize = std::move(_other.m_vertexSize);
             m_vertexCount = std::move(_other.m_vertexCount);
             m_capacity = std::move(_other.m_capacity);
+            m_indices = std::move(_other.m_indices);
+            m_derived = std::move(_other.m_derived);
 
             for (size_t index = 0; index < m_vertexCount; ++index) {
                 m_vertices[index].m_attributes = &m_attributes;
@@ -389,6 +638,8 @@ namespace fmc {
             _other.m_vertexSize = 0;
             _other.m_vertexCount = 0;
             _other.m_capacity = 0;
+            _other.m_indices.clear();
+            _other.m_derived.clear();
         }
 
         return *this;
@@ -406,6 +657,7 @@ namespace fmc {
 
         m_vertices[m_vertexCount].initialize(m_data + m_vertexCount * m_vertexSize, &m_attributes);
         m_vertices[m_vertexCount++] = _vertex;
+        invalidate_derived();
     }
     const void* Mesh::data() const {
         return (const void*)m_data;
@@ -435,8 +687,841 @@ namespace fmc {
     }
     void Mesh::clear() {
         m_vertexCount = 0;
+        m_indices.clear();
         reallocate(1);
     }
+    void Mesh::copy_strided(char* _destination, size_t _destinationStride, const char* _source, size_t _sourceStride, size_t _size, size_t _count) {
+        switch (_size) {
+        case 4: copy_strided<4>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        case 8: copy_strided<8>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        case 12: copy_strided<12>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        case 16: copy_strided<16>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        case 20: copy_strided<20>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        case 24: copy_strided<24>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        case 32: copy_strided<32>(_destination, _destinationStride, _source, _sourceStride, _count); break;
+        default:
+            for (size_t index = 0; index < _count; ++index) {
+                memcpy((void*)(_destination + index * _destinationStride), (const void*)(_source + index * _sourceStride), _size);
+            }
+        }
+    }
+    std::vector<char> Mesh::compress(size_t _threadCount) const {
+        size_t blockCount = (m_vertexCount + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+        std::vector<std::vector<char>> blocks(blockCount);
+        parallel_for(blockCount, _threadCount, [&](size_t _block) {
+            size_t first = _block * COMPRESSION_BLOCK_SIZE;
+            compress_block(first, std::min(COMPRESSION_BLOCK_SIZE, m_vertexCount - first), blocks[_block]);
+        });
+
+        // The header holds the attributes with their sizes, the vertex count, and the end offset of every block.
+        // Type hash ID's aren't stored, as they differ between compilers and aren't guaranteed to be stable between runs
+        std::vector<char> output;
+        auto write = [&output](auto _value) {
+            const char* address = (const char*)&_value;
+            output.insert(output.end(), address, address + sizeof(_value));
+        };
+        write(uint32_t(0x32434D46));
+        write(uint32_t(m_attributes.size()));
+        for (auto attribute : m_attributes) {
+            write(uint32_t(attribute));
+            write(uint32_t(AttributeInfo::get_size(attribute)));
+        }
+        write(uint64_t(m_vertexCount));
+        write(uint32_t(COMPRESSION_BLOCK_SIZE));
+        write(uint32_t(blockCount));
+        uint64_t blockEnd = 0;
+        for (const auto& block : blocks) {
+            blockEnd += block.size();
+            write(blockEnd);
+        }
+
+        output.reserve(output.size() + blockEnd);
+        for (const auto& block : blocks) {
+            output.insert(output.end(), block.begin(), block.end());
+        }
+        return output;
+    }
+    bool Mesh::decompress(const char* _data, size_t _size, size_t _threadCount) {
+        // The data may come from storage or another program, so it's validated in release builds as well
+        size_t offset = 0;
+        auto read = [&](auto& _value) {
+            if (_size - offset < sizeof(_value)) {
+                return false;
+            }
+            memcpy((void*)&_value, (const void*)(_data + offset), sizeof(_value));
+            offset += sizeof(_value);
+            return true;
+        };
+
+        m_vertexCount = 0;
+        m_indices.clear();
+        invalidate_derived();
+
+        uint32_t magic, attributeCount, blockVertexCount, blockCount;
+        uint64_t vertexCount;
+        if (!read(magic) || magic != 0x32434D46 || !read(attributeCount) || attributeCount != m_attributes.size()) {
+            return false;
+        }
+        for (auto attribute : m_attributes) {
+            uint32_t compressedAttribute, compressedSize;
+            if (!read(compressedAttribute) || !read(compressedSize) || compressedAttribute != (uint32_t)attribute || compressedSize != AttributeInfo::get_size(attribute)) {
+                return false;
+            }
+        }
+        if (!read(vertexCount) || !read(blockVertexCount) || !read(blockCount) || blockVertexCount == 0 || blockVertexCount > COMPRESSION_BLOCK_SIZE_MAX ||
+            blockCount != vertexCount / blockVertexCount + (vertexCount % blockVertexCount != 0) || blockCount > (_size - offset) / sizeof(uint64_t)) {
+            return false;
+        }
+
+        std::vector<uint64_t> blockEnds(blockCount);
+        uint64_t previousEnd = 0;
+        for (auto& blockEnd : blockEnds) {
+            if (!read(blockEnd) || blockEnd < previousEnd) {
+                return false;
+            }
+            previousEnd = blockEnd;
+        }
+        const char* payload = _data + offset;
+        // Every plane takes up at least 2 bytes, which bounds the vertex count before anything gets allocated
+        if (previousEnd > _size - offset || blockCount > previousEnd / (2 * m_vertexSize)) {
+            return false;
+        }
+
+        // Decompress straight into the buffer, which only has to grow when the current capacity is too small
+        reserve(vertexCount);
+        std::atomic<bool> valid(true);
+        parallel_for(blockCount, _threadCount, [&](size_t _block) {
+            size_t begin = _block == 0 ? 0 : blockEnds[_block - 1];
+            size_t first = _block * blockVertexCount;
+            if (!decompress_block(payload + begin, blockEnds[_block] - begin, first, std::min<size_t>(blockVertexCount, vertexCount - first))) {
+                valid = false;
+            }
+        });
+        if (!valid) {
+            return false;
+        }
+
+        m_vertexCount = vertexCount;
+        invalidate_derived();
+        return true;
+    }
+    void Mesh::derive(Attribute _attribute, Derivation _derivation) {
+        assert(("Positions can't be derived", _attribute != ATTR_POS));
+        size_t floatCount = AttributeInfo::get_size(_attribute) / sizeof(float);
+        assert(("Derived attribute has the wrong size", floatCount == 3 || (_derivation == DERIVE_TANGENTS && floatCount == 4)));
+        assert(("Positions have the wrong size", AttributeInfo::get_size(ATTR_POS) == 3 * sizeof(float)));
+        assert(("Flat normals can't be derived from indexed triangles with shared vertices", _derivation != DERIVE_FLAT_NORMALS || m_indices.empty()));
+        assert(("Derived attributes are stored separately, so they can't be part of the vertices", std::find(m_attributes.begin(), m_attributes.end(), _attribute) == m_attributes.end()));
+        // Retrieving the offsets asserts that the attributes are part of the mesh
+        get_offset(ATTR_POS);
+        if (_derivation == DERIVE_TANGENTS) {
+            assert(("Normals have the wrong size", AttributeInfo::get_size(ATTR_NORM) == 3 * sizeof(float)));
+            assert(("UVs have the wrong size", AttributeInfo::get_size(ATTR_UV) == 2 * sizeof(float)));
+            assert(("Normals have to be part of the mesh or derived before tangents",
+                find_derived(ATTR_NORM) || std::find(m_attributes.begin(), m_attributes.end(), ATTR_NORM) != m_attributes.end()));
+            get_offset(ATTR_UV);
+        }
+
+        m_derived.erase(std::remove_if(m_derived.begin(), m_derived.end(), [&](const DerivedAttribute& _derived) { return _derived.m_attribute == _attribute; }), m_derived.end());
+        m_derived.push_back({_attribute, _derivation, true, {}});
+        std::stable_sort(m_derived.begin(), m_derived.end(), [](const DerivedAttribute& _a, const DerivedAttribute& _b) { return _a.m_derivation < _b.m_derivation; });
+
+        // Attributes that are derived from this attribute have to be recomputed as well
+        invalidate(_attribute);
+    }
+    void Mesh::invalidate(Attribute _attribute) {
+        for (auto& derived : m_derived) {
+            bool dependent = _attribute == ATTR_POS ||
+                (derived.m_derivation == DERIVE_TANGENTS && (_attribute == ATTR_NORM || _attribute == ATTR_UV));
+            if (dependent && !derived.m_dirty) {
+                derived.m_dirty = true;
+                invalidate(derived.m_attribute);
+            }
+        }
+    }
+    void Mesh::set_indices(const std::vector<uint32_t>& _indices) {
+        assert(("Index count is not a multiple of 3", _indices.size() % 3 == 0));
+#ifndef NDEBUG
+        for (auto index : _indices) {
+            assert(("Index out of range", index < m_vertexCount));
+        }
+        for (const auto& derived : m_derived) {
+            assert(("Flat normals can't be derived from indexed triangles with shared vertices", derived.m_derivation != DERIVE_FLAT_NORMALS || _indices.empty()));
+        }
+#endif
+
+        m_indices = _indices;
+        invalidate(ATTR_POS);
+    }
+    const std::vector<uint32_t>& Mesh::get_indices() const {
+        return m_indices;
+    }
+    void Mesh::compress_block(size_t _first, size_t _count, std::vector<char>& _output) const {
+        // Transpose the vertices into byte planes, where every 4 byte word (or every byte for oddly sized attributes)
+        // is stored as the difference with the same word of the previous vertex
+        std::vector<unsigned char> planes(_count * m_vertexSize);
+        size_t attributeOffset = 0;
+        for (auto attribute : m_attributes) {
+            size_t attributeSize = AttributeInfo::get_size(attribute);
+            size_t wordSize = attributeSize % 4 == 0 ? 4 : 1;
+
+            for (size_t word = attributeOffset; word < attributeOffset + attributeSize; word += wordSize) {
+                const char* source = m_data + _first * m_vertexSize + word;
+                unsigned char* plane = planes.data() + word * _count;
+
+                if (wordSize == 4) {
+                    uint32_t previous = 0;
+                    for (size_t index = 0; index < _count; ++index) {
+                        uint32_t current;
+                        memcpy((void*)&current, (const void*)(source + index * m_vertexSize), 4);
+                        uint32_t delta = current - previous;
+                        previous = current;
+
+                        plane[index] = (unsigned char)delta;
+                        plane[index + _count] = (unsigned char)(delta >> 8);
+                        plane[index + _count * 2] = (unsigned char)(delta >> 16);
+                        plane[index + _count * 3] = (unsigned char)(delta >> 24);
+                    }
+                }
+                else {
+                    unsigned char previous = 0;
+                    for (size_t index = 0; index < _count; ++index) {
+                        unsigned char current = (unsigned char)source[index * m_vertexSize];
+                        plane[index] = (unsigned char)(current - previous);
+                        previous = current;
+                    }
+                }
+            }
+
+            attributeOffset += attributeSize;
+        }
+
+        for (size_t plane = 0; plane < m_vertexSize; ++plane) {
+            compress_plane(planes.data() + plane * _count, _count, _output);
+        }
+    }
+    bool Mesh::decompress_block(const char* _data, size_t _size, size_t _first, size_t _count) {
+        // The planes and words are reused between the blocks that are decompressed by the same thread
+        thread_local std::vector<unsigned char> planes;
+        thread_local std::vector<uint32_t> words;
+        thread_local std::vector<uint32_t> previousWords;
+        planes.resize(_count * m_vertexSize);
+        words.resize(std::min(_count, DECOMPRESSION_BATCH_SIZE));
+        previousWords.resize(m_vertexSize);
+
+        const unsigned char* input = (const unsigned char*)_data;
+        const unsigned char* inputEnd = input + _size;
+        for (size_t plane = 0; plane < m_vertexSize; ++plane) {
+            if (!decompress_plane(input, inputEnd, planes.data() + plane * _count, _count)) {
+                return false;
+            }
+        }
+        if (input != inputEnd) {
+            return false;
+        }
+
+        // Undo the transposition and delta encoding one batch of vertices at a time,
+        // writing the words straight into the mesh's buffer. Gathering the bytes into words is a separate loop so it vectorizes,
+        // only the running sum is sequential
+        uint32_t* delta = words.data();
+        std::fill(previousWords.begin(), previousWords.end(), 0);
+        for (size_t batch = 0; batch < _count; batch += DECOMPRESSION_BATCH_SIZE) {
+            size_t count = std::min(DECOMPRESSION_BATCH_SIZE, _count - batch);
+            char* vertices = m_data + (_first + batch) * m_vertexSize;
+
+            size_t attributeOffset = 0;
+            for (auto attribute : m_attributes) {
+                size_t attributeSize = AttributeInfo::get_size(attribute);
+                size_t wordSize = attributeSize % 4 == 0 ? 4 : 1;
+
+                for (size_t word = attributeOffset; word < attributeOffset + attributeSize; word += wordSize) {
+                    char* destination = vertices + word;
+                    const unsigned char* plane = planes.data() + word * _count + batch;
+
+                    if (wordSize == 4) {
+                        const unsigned char* plane0 = plane;
+                        const unsigned char* plane1 = plane + _count;
+                        const unsigned char* plane2 = plane + _count * 2;
+                        const unsigned char* plane3 = plane + _count * 3;
+                        for (size_t index = 0; index < count; ++index) {
+                            delta[index] = (uint32_t)plane0[index] | ((uint32_t)plane1[index] << 8) | ((uint32_t)plane2[index] << 16) | ((uint32_t)plane3[index] << 24);
+                        }
+
+                        uint32_t previous = previousWords[word];
+                        for (size_t index = 0; index < count; ++index) {
+                            previous += delta[index];
+                            memcpy((void*)(destination + index * m_vertexSize), (const void*)&previous, 4);
+                        }
+                        previousWords[word] = previous;
+                    }
+                    else {
+                        unsigned char previous = (unsigned char)previousWords[word];
+                        for (size_t index = 0; index < count; ++index) {
+                            previous = (unsigned char)(previous + plane[index]);
+                            destination[index * m_vertexSize] = (char)previous;
+                        }
+                        previousWords[word] = previous;
+                    }
+                }
+
+                attributeOffset += attributeSize;
+            }
+
+            for (size_t index = _first + batch; index < _first + batch + count; ++index) {
+                m_vertices[index].initialize(m_data + index * m_vertexSize, &m_attributes);
+            }
+        }
+        return true;
+    }
+    void Mesh::compress_plane(const unsigned char* _plane, size_t _count, std::vector<char>& _output) {
+        uint32_t counts[256] = {};
+        for (size_t index = 0; index < _count; ++index) {
+            counts[_plane[index]]++;
+        }
+        unsigned char common = (unsigned char)(std::max_element(counts, counts + 256) - counts);
+
+        // A control byte with the high bit set is a run of 3 to 130 common bytes, otherwise it's followed by 1 to 128 literal bytes.
+        // Decoding the runs is far cheaper than entropy decoding every byte, so it's used whenever it removes most of the bytes
+        std::vector<unsigned char> runs;
+        if (counts[common] > _count / 2) {
+            size_t position = 0;
+            while (position < _count && runs.size() < _count / 2) {
+                size_t run = 0;
+                while (position + run < _count && _plane[position + run] == common && run < 130) {
+                    ++run;
+                }
+                if (run >= 3) {
+                    runs.push_back((unsigned char)(0x80 | (run - 3)));
+                    position += run;
+                    continue;
+                }
+
+                size_t literalStart = position;
+                while (position < _count && position - literalStart < 128) {
+                    if (position + 2 < _count && _plane[position] == common && _plane[position + 1] == common && _plane[position + 2] == common) {
+                        break;
+                    }
+                    ++position;
+                }
+                runs.push_back((unsigned char)(position - literalStart - 1));
+                runs.insert(runs.end(), _plane + literalStart, _plane + position);
+            }
+
+            if (position == _count && runs.size() < _count / 2) {
+                _output.push_back((char)PLANE_RUN_LENGTH);
+                _output.push_back((char)common);
+                for (size_t byte = 0; byte < 4; ++byte) {
+                    _output.push_back((char)(runs.size() >> (byte * 8)));
+                }
+                compress_bytes(runs.data(), runs.size(), _output);
+                return;
+            }
+        }
+
+        _output.push_back((char)PLANE_DIRECT);
+        compress_bytes(_plane, _count, _output);
+    }
+    bool Mesh::decompress_plane(const unsigned char*& _input, const unsigned char* _inputEnd, unsigned char* _plane, size_t _count) {
+        if (_input == _inputEnd) {
+            return false;
+        }
+        unsigned char encoding = *_input++;
+        if (encoding == PLANE_DIRECT) {
+            return decompress_bytes(_input, _inputEnd, _plane, _count);
+        }
+        if (encoding != PLANE_RUN_LENGTH || _inputEnd - _input < 5) {
+            return false;
+        }
+
+        unsigned char common = *_input++;
+        uint32_t runsSize = (uint32_t)_input[0] | ((uint32_t)_input[1] << 8) | ((uint32_t)_input[2] << 16) | ((uint32_t)_input[3] << 24);
+        _input += 4;
+        if (runsSize == 0 || runsSize > _count) {
+            return false;
+        }
+        thread_local std::vector<unsigned char> runs;
+        runs.resize(runsSize);
+        if (!decompress_bytes(_input, _inputEnd, runs.data(), runsSize)) {
+            return false;
+        }
+
+        const unsigned char* run = runs.data();
+        const unsigned char* runEnd = run + runsSize;
+        size_t position = 0;
+        while (run < runEnd) {
+            unsigned char control = *run++;
+            size_t length = (control & 0x80) ? (control & 0x7F) + 3 : control + 1;
+            if (length > _count - position) {
+                return false;
+            }
+
+            if (control & 0x80) {
+                memset((void*)(_plane + position), common, length);
+            }
+            else {
+                if (length > (size_t)(runEnd - run)) {
+                    return false;
+                }
+                memcpy((void*)(_plane + position), (const void*)run, length);
+                run += length;
+            }
+            position += length;
+        }
+        return position == _count;
+    }
+    void Mesh::compress_bytes(const unsigned char* _bytes, size_t _count, std::vector<char>& _output) {
+        uint32_t counts[256] = {};
+        for (size_t index = 0; index < _count; ++index) {
+            counts[_bytes[index]]++;
+        }
+        size_t symbolCount = 0;
+        for (auto count : counts) {
+            symbolCount += count != 0;
+        }
+        if (symbolCount <= 1) {
+            _output.push_back((char)BYTES_CONSTANT);
+            _output.push_back((char)_bytes[0]);
+            return;
+        }
+
+        // Scale the counts so they add up to the probability scale, while keeping every occurring symbol representable
+        const uint32_t scale = 1u << RANS_SCALE_BITS;
+        uint32_t frequencies[256];
+        uint32_t total = 0;
+        for (size_t symbol = 0; symbol < 256; ++symbol) {
+            frequencies[symbol] = counts[symbol] == 0 ? 0 : std::max<uint32_t>(1, (uint32_t)((uint64_t)counts[symbol] * scale / _count));
+            total += frequencies[symbol];
+        }
+        while (total != scale) {
+            // Adjust the most frequent symbol that can still be adjusted, which costs the least compression
+            size_t best = 256;
+            for (size_t symbol = 0; symbol < 256; ++symbol) {
+                if ((total < scale ? counts[symbol] != 0 : frequencies[symbol] > 1) && (best == 256 || counts[symbol] > counts[best])) {
+                    best = symbol;
+                }
+            }
+            uint32_t adjustment = total < scale ? scale - total : std::min(total - scale, frequencies[best] - 1);
+            frequencies[best] = total < scale ? frequencies[best] + adjustment : frequencies[best] - adjustment;
+            total = total < scale ? total + adjustment : total - adjustment;
+        }
+        uint32_t starts[256];
+        for (size_t symbol = 0, start = 0; symbol < 256; ++symbol) {
+            starts[symbol] = (uint32_t)start;
+            start += frequencies[symbol];
+        }
+
+        // The encoder runs backwards, so the decoder can read the stream and the symbols forwards.
+        // A symbol never takes more than 2 bytes, as every frequency is at least 1 out of 2^12
+        std::vector<unsigned char> encoded(_count * 2 + RANS_STATE_COUNT * 4);
+        unsigned char* output = encoded.data() + encoded.size();
+        uint32_t states[RANS_STATE_COUNT];
+        std::fill(states, states + RANS_STATE_COUNT, RANS_LOWER_BOUND);
+        for (size_t index = _count; index-- > 0;) {
+            uint32_t& state = states[index % RANS_STATE_COUNT];
+            uint32_t frequency = frequencies[_bytes[index]];
+            if (state >= ((RANS_LOWER_BOUND >> RANS_SCALE_BITS) << 16) * frequency) {
+                output -= 2;
+                output[0] = (unsigned char)state;
+                output[1] = (unsigned char)(state >> 8);
+                state >>= 16;
+            }
+            state = ((state / frequency) << RANS_SCALE_BITS) + state % frequency + starts[_bytes[index]];
+        }
+        for (size_t stateIndex = RANS_STATE_COUNT; stateIndex-- > 0;) {
+            output -= 4;
+            for (size_t byte = 0; byte < 4; ++byte) {
+                output[byte] = (unsigned char)(states[stateIndex] >> (byte * 8));
+            }
+        }
+        size_t encodedSize = (size_t)(encoded.data() + encoded.size() - output);
+
+        // The symbol table holds every occurring symbol with its frequency as a variable length integer
+        std::vector<char> table;
+        table.push_back((char)(symbolCount - 1));
+        for (size_t symbol = 0; symbol < 256; ++symbol) {
+            if (frequencies[symbol] != 0) {
+                table.push_back((char)symbol);
+                for (uint32_t frequency = frequencies[symbol]; ; frequency >>= 7) {
+                    table.push_back((char)((frequency & 0x7F) | (frequency >= 0x80 ? 0x80 : 0)));
+                    if (frequency < 0x80) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (table.size() + 4 + encodedSize >= _count) {
+            _output.push_back((char)BYTES_RAW);
+            _output.insert(_output.end(), (const char*)_bytes, (const char*)_bytes + _count);
+            return;
+        }
+        _output.push_back((char)BYTES_RANS);
+        _output.insert(_output.end(), table.begin(), table.end());
+        for (size_t byte = 0; byte < 4; ++byte) {
+            _output.push_back((char)(encodedSize >> (byte * 8)));
+        }
+        _output.insert(_output.end(), (const char*)output, (const char*)output + encodedSize);
+    }
+    bool Mesh::decompress_bytes(const unsigned char*& _input, const unsigned char* _inputEnd, unsigned char* _bytes, size_t _count) {
+        if (_inputEnd - _input < 2) {
+            return false;
+        }
+        unsigned char encoding = *_input++;
+        if (encoding == BYTES_CONSTANT) {
+            memset((void*)_bytes, *_input++, _count);
+            return true;
+        }
+        if (encoding == BYTES_RAW) {
+            if ((size_t)(_inputEnd - _input) < _count) {
+                return false;
+            }
+            memcpy((void*)_bytes, (const void*)_input, _count);
+            _input += _count;
+            return true;
+        }
+        if (encoding != BYTES_RANS) {
+            return false;
+        }
+
+        // Every slot of the probability scale holds its symbol, the symbol's frequency, and the slot's distance from the symbol's start
+        const uint32_t scale = 1u << RANS_SCALE_BITS;
+        struct Slot {
+            uint16_t m_frequency;
+            uint16_t m_bias;
+        };
+        Slot slots[1u << RANS_SCALE_BITS];
+        unsigned char symbols[1u << RANS_SCALE_BITS];
+        size_t symbolCount = (size_t)*_input++ + 1;
+        uint32_t start = 0;
+        bool used[256] = {};
+        for (size_t i = 0; i < symbolCount; ++i) {
+            if (_input == _inputEnd || used[*_input]) {
+                return false;
+            }
+            uint32_t symbol = *_input++;
+            used[symbol] = true;
+
+            uint32_t frequency = 0;
+            for (uint32_t shift = 0; ; shift += 7) {
+                if (_input == _inputEnd || shift > 14) {
+                    return false;
+                }
+                unsigned char byte = *_input++;
+                frequency |= (uint32_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            // With at least 2 symbols every frequency fits in 12 bits
+            if (frequency == 0 || frequency >= scale || frequency > scale - start) {
+                return false;
+            }
+
+            for (uint32_t slot = start; slot < start + frequency; ++slot) {
+                slots[slot] = {(uint16_t)frequency, (uint16_t)(slot - start)};
+                symbols[slot] = (unsigned char)symbol;
+            }
+            start += frequency;
+        }
+        if (start != scale || _inputEnd - _input < 4) {
+            return false;
+        }
+
+        uint32_t encodedSize = (uint32_t)_input[0] | ((uint32_t)_input[1] << 8) | ((uint32_t)_input[2] << 16) | ((uint32_t)_input[3] << 24);
+        _input += 4;
+        if ((size_t)(_inputEnd - _input) < encodedSize || encodedSize < RANS_STATE_COUNT * 4) {
+            return false;
+        }
+        const unsigned char* input = _input;
+        const unsigned char* inputEnd = _input + encodedSize;
+        _input = inputEnd;
+
+        uint32_t states[RANS_STATE_COUNT];
+        for (auto& state : states) {
+            state = (uint32_t)input[0] | ((uint32_t)input[1] << 8) | ((uint32_t)input[2] << 16) | ((uint32_t)input[3] << 24);
+            input += 4;
+            if (state < RANS_LOWER_BOUND) {
+                return false;
+            }
+        }
+
+        // A decoded state never drops below 2^4, so a single word always gets it back above the lower bound.
+        // The word is shifted in arithmetically rather than with a branch, as whether it's needed is unpredictable for noisy planes
+        auto decode = [&](uint32_t& _state) {
+            uint32_t slot = _state & (scale - 1);
+            _state = slots[slot].m_frequency * (_state >> RANS_SCALE_BITS) + slots[slot].m_bias;
+            uint32_t read = _state < RANS_LOWER_BOUND;
+            uint32_t mask = 0u - read;
+            uint32_t word = (uint32_t)input[0] | ((uint32_t)input[1] << 8);
+            _state = (((_state << 16) | word) & mask) | (_state & ~mask);
+            input += read * 2;
+            return symbols[slot];
+        };
+
+        // Decode a symbol per state at a time with the states in registers, skipping the bounds checks while the states can't
+        // exhaust the input. The states are independent, so their table lookups and multiplications overlap
+        static_assert(RANS_STATE_COUNT == 8, "The decoding loop is unrolled for 8 states");
+        uint32_t state0 = states[0], state1 = states[1], state2 = states[2], state3 = states[3];
+        uint32_t state4 = states[4], state5 = states[5], state6 = states[6], state7 = states[7];
+        size_t index = 0;
+        for (; index + RANS_STATE_COUNT <= _count && (size_t)(inputEnd - input) >= RANS_STATE_COUNT * 2; index += RANS_STATE_COUNT) {
+            _bytes[index] = decode(state0);
+            _bytes[index + 1] = decode(state1);
+            _bytes[index + 2] = decode(state2);
+            _bytes[index + 3] = decode(state3);
+            _bytes[index + 4] = decode(state4);
+            _bytes[index + 5] = decode(state5);
+            _bytes[index + 6] = decode(state6);
+            _bytes[index + 7] = decode(state7);
+        }
+        states[0] = state0;
+        states[1] = state1;
+        states[2] = state2;
+        states[3] = state3;
+        states[4] = state4;
+        states[5] = state5;
+        states[6] = state6;
+        states[7] = state7;
+
+        for (; index < _count; ++index) {
+            uint32_t& state = states[index % RANS_STATE_COUNT];
+            uint32_t slot = state & (scale - 1);
+            _bytes[index] = symbols[slot];
+            state = slots[slot].m_frequency * (state >> RANS_SCALE_BITS) + slots[slot].m_bias;
+            if (state < RANS_LOWER_BOUND) {
+                if (inputEnd - input < 2) {
+                    return false;
+                }
+                state = (state << 16) | (uint32_t)input[0] | ((uint32_t)input[1] << 8);
+                input += 2;
+            }
+        }
+
+        // A correctly decoded plane ends with every state back at its initial value, and all encoded bytes consumed
+        return input == inputEnd && std::all_of(states, states + RANS_STATE_COUNT, [](uint32_t _state) { return _state == RANS_LOWER_BOUND; });
+    }
+    size_t Mesh::get_offset(Attribute _attribute) const {
+        size_t vertexOffset = 0;
+        for (const auto& attribute : m_attributes) {
+            if (attribute == _attribute) {
+                return vertexOffset;
+            }
+
+            vertexOffset += AttributeInfo::get_size(attribute);
+        }
+
+        assert(("Unused attribute type", false));
+        return 0;
+    }
+    Mesh::DerivedAttribute* Mesh::find_derived(Attribute _attribute) {
+        for (auto& derived : m_derived) {
+            if (derived.m_attribute == _attribute) {
+                return &derived;
+            }
+        }
+        return nullptr;
+    }
+    const Mesh::DerivedAttribute* Mesh::find_derived(Attribute _attribute) const {
+        for (const auto& derived : m_derived) {
+            if (derived.m_attribute == _attribute) {
+                return &derived;
+            }
+        }
+        return nullptr;
+    }
+    const char* Mesh::get_source(Attribute _attribute, size_t& _stride) const {
+        const DerivedAttribute* derived = find_derived(_attribute);
+        if (derived) {
+            _stride = AttributeInfo::get_size(_attribute);
+            return derived->m_stream.data();
+        }
+
+        _stride = m_vertexSize;
+        return m_data + get_offset(_attribute);
+    }
+    void Mesh::invalidate_derived() {
+        for (auto& derived : m_derived) {
+            derived.m_dirty = true;
+        }
+    }
+    void Mesh::update_derived() {
+        for (auto& derived : m_derived) {
+            update_derived(derived);
+        }
+    }
+    void Mesh::update_derived(DerivedAttribute& _derived) {
+        if (!_derived.m_dirty) {
+            return;
+        }
+
+        if (_derived.m_derivation == DERIVE_TANGENTS) {
+            DerivedAttribute* normals = find_derived(ATTR_NORM);
+            if (normals) {
+                update_derived(*normals);
+            }
+            compute_tangents(_derived);
+        }
+        else {
+            compute_normals(_derived);
+        }
+        _derived.m_dirty = false;
+    }
+    void Mesh::build_adjacency(std::vector<uint32_t>& _adjacencyStart, std::vector<uint32_t>& _adjacency) const {
+        size_t cornerCount = m_indices.empty() ? m_vertexCount - m_vertexCount % 3 : m_indices.size();
+        auto corner = [&](size_t _corner) -> size_t { return m_indices.empty() ? _corner : m_indices[_corner]; };
+
+        // Count the triangles per vertex, and turn the counts into the starting position of every vertex's triangle list
+        _adjacencyStart.assign(m_vertexCount + 1, 0);
+        for (size_t index = 0; index < cornerCount; ++index) {
+            assert(("Index out of range", corner(index) < m_vertexCount));
+            _adjacencyStart[corner(index) + 1]++;
+        }
+        for (size_t vertex = 0; vertex < m_vertexCount; ++vertex) {
+            _adjacencyStart[vertex + 1] += _adjacencyStart[vertex];
+        }
+
+        _adjacency.resize(cornerCount);
+        std::vector<uint32_t> adjacencyEnd(_adjacencyStart.begin(), _adjacencyStart.end() - 1);
+        for (size_t index = 0; index < cornerCount; ++index) {
+            _adjacency[adjacencyEnd[corner(index)]++] = (uint32_t)(index / 3);
+        }
+    }
+    void Mesh::compute_normals(DerivedAttribute& _derived) {
+        assert(("Flat normals can't be derived from indexed triangles with shared vertices", _derived.m_derivation != DERIVE_FLAT_NORMALS || m_indices.empty()));
+
+        const size_t chunkSize = 4096;
+        size_t positionOffset = get_offset(ATTR_POS);
+        _derived.m_stream.resize(m_vertexCount * 3 * sizeof(float));
+        float* normals = (float*)_derived.m_stream.data();
+        size_t triangleCount = (m_indices.empty() ? m_vertexCount : m_indices.size()) / 3;
+        auto corner = [&](size_t _corner) -> size_t { return m_indices.empty() ? _corner : m_indices[_corner]; };
+        auto position = [&](size_t _vertex) { return (const float*)(m_data + _vertex * m_vertexSize + positionOffset); };
+
+        // Find the triangles that every vertex is part of, so every vertex can gather its normal without write conflicts.
+        // This also validates the indices before any positions are read through them
+        std::vector<uint32_t> adjacencyStart, adjacency;
+        build_adjacency(adjacencyStart, adjacency);
+
+        // Compute the area weighted normal of every triangle, stored as separate x, y, and z arrays
+        std::vector<float> faces(triangleCount * 3);
+        float* faceX = faces.data();
+        float* faceY = faceX + triangleCount;
+        float* faceZ = faceY + triangleCount;
+        parallel_for((triangleCount + chunkSize - 1) / chunkSize, 0, [&](size_t _chunk) {
+            size_t end = std::min(triangleCount, (_chunk + 1) * chunkSize);
+            for (size_t triangle = _chunk * chunkSize; triangle < end; ++triangle) {
+                const float* p0 = position(corner(triangle * 3));
+                const float* p1 = position(corner(triangle * 3 + 1));
+                const float* p2 = position(corner(triangle * 3 + 2));
+                float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+                float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+                faceX[triangle] = e1[1] * e2[2] - e1[2] * e2[1];
+                faceY[triangle] = e1[2] * e2[0] - e1[0] * e2[2];
+                faceZ[triangle] = e1[0] * e2[1] - e1[1] * e2[0];
+            }
+        });
+
+        parallel_for((m_vertexCount + chunkSize - 1) / chunkSize, 0, [&](size_t _chunk) {
+            size_t end = std::min(m_vertexCount, (_chunk + 1) * chunkSize);
+            for (size_t vertex = _chunk * chunkSize; vertex < end; ++vertex) {
+                // Without indices every vertex is part of a single triangle, so this results in flat normals
+                float normal[3] = {0.f, 0.f, 0.f};
+                for (uint32_t i = adjacencyStart[vertex]; i < adjacencyStart[vertex + 1]; ++i) {
+                    normal[0] += faceX[adjacency[i]];
+                    normal[1] += faceY[adjacency[i]];
+                    normal[2] += faceZ[adjacency[i]];
+                }
+
+                float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                float scale = length > 0.f ? 1.f / length : 0.f;
+                float* destination = normals + vertex * 3;
+                destination[0] = normal[0] * scale;
+                destination[1] = normal[1] * scale;
+                destination[2] = normal[2] * scale;
+            }
+        });
+    }
+    void Mesh::compute_tangents(DerivedAttribute& _derived) {
+        const size_t chunkSize = 4096;
+        size_t positionOffset = get_offset(ATTR_POS);
+        size_t uvOffset = get_offset(ATTR_UV);
+        // The normals are either part of the vertices or derived themselves, in which case they were computed first
+        size_t normalStride;
+        const char* normals = get_source(ATTR_NORM, normalStride);
+        size_t floatCount = AttributeInfo::get_size(_derived.m_attribute) / sizeof(float);
+        _derived.m_stream.resize(m_vertexCount * floatCount * sizeof(float));
+        float* tangents = (float*)_derived.m_stream.data();
+        size_t triangleCount = (m_indices.empty() ? m_vertexCount : m_indices.size()) / 3;
+        auto corner = [&](size_t _corner) -> size_t { return m_indices.empty() ? _corner : m_indices[_corner]; };
+        auto attribute = [&](size_t _vertex, size_t _offset) { return (const float*)(m_data + _vertex * m_vertexSize + _offset); };
+
+        std::vector<uint32_t> adjacencyStart, adjacency;
+        build_adjacency(adjacencyStart, adjacency);
+
+        // Compute the tangent and bitangent of every triangle from its UV gradients, stored as separate arrays per component
+        std::vector<float> faces(triangleCount * 6);
+        float* faceTangent[3] = {faces.data(), faces.data() + triangleCount, faces.data() + triangleCount * 2};
+        float* faceBitangent[3] = {faces.data() + triangleCount * 3, faces.data() + triangleCount * 4, faces.data() + triangleCount * 5};
+        parallel_for((triangleCount + chunkSize - 1) / chunkSize, 0, [&](size_t _chunk) {
+            size_t end = std::min(triangleCount, (_chunk + 1) * chunkSize);
+            for (size_t triangle = _chunk * chunkSize; triangle < end; ++triangle) {
+                size_t v0 = corner(triangle * 3), v1 = corner(triangle * 3 + 1), v2 = corner(triangle * 3 + 2);
+                const float* p0 = attribute(v0, positionOffset);
+                const float* p1 = attribute(v1, positionOffset);
+                const float* p2 = attribute(v2, positionOffset);
+                const float* uv0 = attribute(v0, uvOffset);
+                const float* uv1 = attribute(v1, uvOffset);
+                const float* uv2 = attribute(v2, uvOffset);
+
+                float du1 = uv1[0] - uv0[0], dv1 = uv1[1] - uv0[1];
+                float du2 = uv2[0] - uv0[0], dv2 = uv2[1] - uv0[1];
+                float determinant = du1 * dv2 - du2 * dv1;
+                // Triangles with degenerate UVs don't contribute to the tangents of their vertices
+                float scale = determinant != 0.f ? 1.f / determinant : 0.f;
+                for (size_t axis = 0; axis < 3; ++axis) {
+                    float e1 = p1[axis] - p0[axis];
+                    float e2 = p2[axis] - p0[axis];
+                    faceTangent[axis][triangle] = (e1 * dv2 - e2 * dv1) * scale;
+                    faceBitangent[axis][triangle] = (e2 * du1 - e1 * du2) * scale;
+                }
+            }
+        });
+
+        // Sum the triangle tangents of every vertex, and orthonormalize the result against the vertex normal
+        parallel_for((m_vertexCount + chunkSize - 1) / chunkSize, 0, [&](size_t _chunk) {
+            size_t end = std::min(m_vertexCount, (_chunk + 1) * chunkSize);
+            for (size_t vertex = _chunk * chunkSize; vertex < end; ++vertex) {
+                float tangent[3] = {0.f, 0.f, 0.f};
+                float bitangent[3] = {0.f, 0.f, 0.f};
+                for (uint32_t i = adjacencyStart[vertex]; i < adjacencyStart[vertex + 1]; ++i) {
+                    for (size_t axis = 0; axis < 3; ++axis) {
+                        tangent[axis] += faceTangent[axis][adjacency[i]];
+                        bitangent[axis] += faceBitangent[axis][adjacency[i]];
+                    }
+                }
+
+                const float* n = (const float*)(normals + vertex * normalStride);
+                float dot = n[0] * tangent[0] + n[1] * tangent[1] + n[2] * tangent[2];
+                for (size_t axis = 0; axis < 3; ++axis) {
+                    tangent[axis] -= n[axis] * dot;
+                }
+                float length = std::sqrt(tangent[0] * tangent[0] + tangent[1] * tangent[1] + tangent[2] * tangent[2]);
+                float scale = length > 0.f ? 1.f / length : 0.f;
+
+                float* destination = tangents + vertex * floatCount;
+                destination[0] = tangent[0] * scale;
+                destination[1] = tangent[1] * scale;
+                destination[2] = tangent[2] * scale;
+                if (floatCount == 4) {
+                    // The bitangent sign tells whether the UV mapping is mirrored
+                    float handedness = (n[1] * tangent[2] - n[2] * tangent[1]) * bitangent[0] +
+                        (n[2] * tangent[0] - n[0] * tangent[2]) * bitangent[1] +
+                        (n[0] * tangent[1] - n[1] * tangent[0]) * bitangent[2];
+                    destination[3] = handedness < 0.f ? -1.f : 1.f;
+                }
+            }
+        });
+    }
     void Mesh::reallocate(size_t _capacity) {
         m_capacity = _capacity;
 
@@ -452,6 +1537,82 @@ namespace fmc {
         }
     }
 
+    Mesh repack(const Mesh& _source, const std::vector<Attribute>& _attributes, size_t _threadCount) {
+        assert(("No attributes to repack", !_attributes.empty()));
+#ifndef NDEBUG
+        for (auto attribute = _attributes.begin(); attribute != _attributes.end(); ++attribute) {
+            assert(("Duplicate attribute", std::find(attribute + 1, _attributes.end(), *attribute) == _attributes.end()));
+        }
+#endif
+
+        // Find the byte ranges to copy per vertex, merging attributes that stay adjacent into a single copy.
+        // Derived attributes are copied from their streams, and become regular attributes of the new mesh
+        struct Copy {
+            const Mesh::DerivedAttribute* m_derived;
+            size_t m_sourceOffset;
+            size_t m_destinationOffset;
+            size_t m_size;
+        };
+        std::vector<Copy> copies;
+        size_t destinationOffset = 0;
+        for (auto attribute : _attributes) {
+            const Mesh::DerivedAttribute* derived = _source.find_derived(attribute);
+            // The source mesh is const, so the derived attributes that are repacked can't be recomputed here
+            assert(("Derived attribute is out of date, call update_derived() first", !derived || !derived->m_dirty));
+            size_t sourceOffset = derived ? 0 : _source.get_offset(attribute);
+            size_t attributeSize = AttributeInfo::get_size(attribute);
+            if (!derived && !copies.empty() && !copies.back().m_derived && copies.back().m_sourceOffset + copies.back().m_size == sourceOffset &&
+                copies.back().m_destinationOffset + copies.back().m_size == destinationOffset) {
+                copies.back().m_size += attributeSize;
+            }
+            else {
+                copies.push_back({derived, sourceOffset, destinationOffset, attributeSize});
+            }
+            destinationOffset += attributeSize;
+        }
+
+        Mesh mesh(_attributes);
+        mesh.reserve(_source.m_vertexCount);
+
+        // Copy the vertices in small batches that fit in the L1 cache, so every source cache line is only fetched from memory once.
+        // Within a batch every copy range is a loop with a fixed size, which the compiler turns into plain moves
+        const size_t chunkSize = 4096;
+        const size_t batchSize = 256;
+        Mesh::parallel_for((_source.m_vertexCount + chunkSize - 1) / chunkSize, _threadCount, [&](size_t _chunk) {
+            size_t end = std::min(_source.m_vertexCount, (_chunk + 1) * chunkSize);
+            for (size_t first = _chunk * chunkSize; first < end; first += batchSize) {
+                size_t count = std::min(batchSize, end - first);
+                const char* source = _source.m_data + first * _source.m_vertexSize;
+                char* destination = mesh.m_data + first * mesh.m_vertexSize;
+                for (const auto& copy : copies) {
+                    if (copy.m_derived) {
+                        Mesh::copy_strided(destination + copy.m_destinationOffset, mesh.m_vertexSize, copy.m_derived->m_stream.data() + first * copy.m_size, copy.m_size, copy.m_size, count);
+                    }
+                    else {
+                        Mesh::copy_strided(destination + copy.m_destinationOffset, mesh.m_vertexSize, source + copy.m_sourceOffset, _source.m_vertexSize, copy.m_size, count);
+                    }
+                }
+            }
+            for (size_t index = _chunk * chunkSize; index < end; ++index) {
+                mesh.m_vertices[index].initialize(mesh.m_data + index * mesh.m_vertexSize, &mesh.m_attributes);
+            }
+        });
+        mesh.m_vertexCount = _source.m_vertexCount;
+        mesh.m_indices = _source.m_indices;
+
+        // Derived attributes that weren't repacked keep their streams, as long as the attributes they are derived from are kept as well.
+        // Normals come before tangents, so derived normals that tangents depend on have already been kept
+        auto contains = [&](Attribute _attribute) { return std::find(_attributes.begin(), _attributes.end(), _attribute) != _attributes.end(); };
+        for (const auto& derived : _source.m_derived) {
+            if (!contains(derived.m_attribute) && contains(ATTR_POS) &&
+                (derived.m_derivation != DERIVE_TANGENTS || ((contains(ATTR_NORM) || mesh.find_derived(ATTR_NORM)) && contains(ATTR_UV)))) {
+                mesh.m_derived.push_back(derived);
+            }
+        }
+
+        return mesh;
+    }
+
     Vertex::Vertex(std::initializer_list<Attribute> _attributes) {
         size_t vertexSize = 0;
         m_attributes = new std::vector<Attribute>;